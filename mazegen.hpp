@@ -10,6 +10,10 @@
 #include <random>
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <new>
 
 
 namespace mazegen {
@@ -19,6 +23,8 @@ const int MAX_ROOMS = 1000000;
 const int HALL_ID_START = 0;
 const int ROOM_ID_START = MAX_ROOMS;
 const int DOOR_ID_START = MAX_ROOMS * 2;
+const int MAX_VISIBILITY_RADIUS = 16;
+const int ROOM_FIT_ATTEMPTS = 32;
 
 namespace {
     typedef std::vector<std::vector<int>> Grid;
@@ -39,6 +45,36 @@ namespace {
     typedef std::array<Direction, 4> Directions;
     const Directions CARDINALS  {{ {0, -1}, {1, 0}, {0, 1}, {-1, 0} }};
 
+    // Occupied room cells used by targeted room placement
+    // Room cells are the odd grid coordinates: 2 * x + 1 maps to x
+    typedef std::vector<std::vector<bool>> CellGrid;
+
+    // Returns up to 64 bits of a bitset starting at the bit position
+    uint64_t read_bits(const uint64_t* words, size_t position, int number) {
+        size_t word = position / 64;
+        int shift = position % 64;
+        uint64_t value = words[word] >> shift;
+        if (shift + number > 64) value |= words[word + 1] << (64 - shift);
+        return number == 64 ? value : value & ((uint64_t{1} << number) - 1);
+    }
+
+    // Sets up to 64 bits of a bitset starting at the bit position, the bits must be cleared before
+    void write_bits(uint64_t* words, size_t position, int number, uint64_t value) {
+        size_t word = position / 64;
+        int shift = position % 64;
+        words[word] |= value << shift;
+        if (shift + number > 64) words[word + 1] |= value >> (64 - shift);
+    }
+
+    // Returns the largest dx such that dx * dx + dy * dy <= radius * radius
+    int circle_half_width(int radius, int dy) {
+        long long rest = static_cast<long long>(radius) * radius - static_cast<long long>(dy) * dy;
+        int half_width = static_cast<int>(std::sqrt(static_cast<double>(rest)));
+        while (static_cast<long long>(half_width) * half_width > rest) half_width--;
+        while (static_cast<long long>(half_width + 1) * (half_width + 1) <= rest) half_width++;
+        return half_width;
+    }
+
 }
 
 struct Config {
@@ -52,12 +88,23 @@ struct Config {
     float EXTRA_CONNECTION_CHANCE = 0.0;
     // How many times room placement is attempted
     int ROOM_BASE_NUMBER = 30;
+    // If > 0, rooms are placed only where they fit until this many rooms are placed, ROOM_BASE_NUMBER is ignored
+    int ROOM_TARGET_NUMBER = 0;
+    // If > 0, rooms are placed only where they fit until they cover this part of the maze area, ROOM_BASE_NUMBER is ignored
+    // If both targets are set, the placement stops at the first one reached
+    // A room is shrunk only if it did not fit at ROOM_FIT_ATTEMPTS corners, so small rooms are slightly more common when the maze fills up
+    float ROOM_TARGET_COVERAGE = 0.0;
     // Room minimum dimension
     int ROOM_SIZE_MIN = 7;
     // Room maximum dimension
     int ROOM_SIZE_MAX = 9;
     // True if hall constaraints are to be exclusively in halls, not in rooms
     bool CONSTRAIN_HALL_ONLY = false;
+    // True if visibility is precomputed for every hall, room and door cell after the generation
+    bool BUILD_VISIBILITY = false;
+    // Radius of the precomputed visibility, at most MAX_VISIBILITY_RADIUS, visible_cells() with larger radius is computed directly
+    // Each open cell takes ((2 * radius + 1)^2 + 63) / 64 * 8 bytes: 40 bytes for radius 8, 144 bytes for radius 16
+    int VISIBILITY_RADIUS = 8;
 };
 
 
@@ -117,6 +164,34 @@ struct Door {
 };
 
 
+// Square bitmap of the cells visible from a point, reused by Generator::visible_cells()
+struct VisibilityBitmap {
+    int min_x = 0;
+    int min_y = 0;
+    int size = 0;
+    std::vector<uint64_t> bits;
+    // returns true if a cell is visible, cells out of the bitmap are never visible
+    bool is_visible(int x, int y) const {
+        int dx = x - min_x;
+        int dy = y - min_y;
+        if (dx < 0 || dy < 0 || dx >= size || dy >= size) return false;
+        size_t i = static_cast<size_t>(dy) * size + dx;
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+    void set_visible(int x, int y) {
+        size_t i = static_cast<size_t>(y - min_y) * size + (x - min_x);
+        bits[i / 64] |= uint64_t{1} << (i % 64);
+    }
+    // centers the bitmap around a point and clears it, keeps the allocated memory
+    void reset(int x, int y, int radius) {
+        min_x = x - radius;
+        min_y = y - radius;
+        size = 2 * radius + 1;
+        bits.assign((static_cast<size_t>(size) * size + 63) / 64, 0);
+    }
+};
+
+
 inline bool is_hall(int id) {
     return id >= HALL_ID_START && id < ROOM_ID_START;
 }
@@ -148,6 +223,7 @@ void generate(int width, int height, const Config& user_config, const PointSet&
     reduce_connectivity();
     reduce_maze();
     reconnect_dead_ends();
+    build_visibility();
 }
 
 
@@ -201,6 +277,24 @@ const Config& get_config() const noexcept{
 }
 
 
+// returns cells visible from a point within the radius, walls block the sight but are visible themselves
+// cells out of the maze are never set, a wall point sees nothing
+// from inside a room or its door the whole room with its wall ring is visible without line of sight tests
+// the radius is clamped to [0, max(maze_width(), maze_height())], the returned bitmap is reused by the next call
+const VisibilityBitmap& visible_cells(int x, int y, int radius) noexcept {
+    radius = std::clamp(radius, 0, std::max(maze_width(), maze_height()));
+    visibility_bitmap.reset(x, y, radius);
+    if (region_at(x, y) == NOTHING_ID) return visibility_bitmap;
+    int cache_slot = los_slots.empty() ? -1 : los_slots[y * maze_width() + x];
+    if (cache_slot >= 0 && radius <= los_radius) {
+        copy_cached_cells(cache_slot, radius);
+    } else {
+        compute_visible_cells(x, y, radius);
+    }
+    return visibility_bitmap;
+}
+
+
 int maze_height() const noexcept{
     return grid.size();
 }
@@ -233,6 +327,16 @@ int door_id = DOOR_ID_START;
 bool is_seed_set = false;
 unsigned int random_seed;
 
+// Rooms visible as a whole from a point, unused ones are nullptr
+typedef std::array<const Room*, 4> OpenRooms;
+
+// Precomputed visibility for the open cells, each cell has a square bitmap of VISIBILITY_RADIUS
+std::vector<uint64_t> los_cache;
+std::vector<int> los_slots; // number of the cell bitmap in los_cache by y * width + x, -1 if not cached
+size_t los_words_per_cell = 0;
+int los_radius = 0;
+VisibilityBitmap visibility_bitmap;
+
 
 // Clears all the generated data for consequent generation 
 void clear() {
@@ -241,6 +345,10 @@ void clear() {
     halls.clear();
     doors.clear();
     warnings.clear();
+    los_cache.clear();
+    los_slots.clear();
+    los_words_per_cell = 0;
+    los_radius = 0;
     maze_region_id = HALL_ID_START;
     room_id = ROOM_ID_START;
     door_id = DOOR_ID_START;
@@ -316,6 +424,23 @@ Config fix_config(const Config& user_config) {
         if (fixed.ROOM_BASE_NUMBER < 0) fixed.ROOM_BASE_NUMBER = 0;
         warnings.append("Warning! ROOM_BASE_NUMBER must belong to[0, " + std::to_string(MAX_ROOMS - 1) + "]. Fixed by clamping.\n");
     }
+    if (fixed.ROOM_TARGET_NUMBER >= MAX_ROOMS || fixed.ROOM_TARGET_NUMBER < 0) {
+        if (fixed.ROOM_TARGET_NUMBER >= MAX_ROOMS) fixed.ROOM_TARGET_NUMBER = MAX_ROOMS - 1;
+        if (fixed.ROOM_TARGET_NUMBER < 0) fixed.ROOM_TARGET_NUMBER = 0;
+        warnings.append("Warning! ROOM_TARGET_NUMBER must belong to[0, " + std::to_string(MAX_ROOMS - 1) + "]. Fixed by clamping.\n");
+    }
+    if (fixed.ROOM_TARGET_COVERAGE < 0.0f || fixed.ROOM_TARGET_COVERAGE > 1.0f) {
+        fixed.ROOM_TARGET_COVERAGE = std::clamp(fixed.ROOM_TARGET_COVERAGE, 0.0f, 1.0f);
+        warnings.append("Warning! ROOM_TARGET_COVERAGE must be between 0.0f and 1.0f. Fixed by clamping.\n");
+    }
+    if (fixed.BUILD_VISIBILITY) {
+        if (fixed.VISIBILITY_RADIUS < 0 || fixed.VISIBILITY_RADIUS > MAX_VISIBILITY_RADIUS) {
+            fixed.VISIBILITY_RADIUS = std::clamp(fixed.VISIBILITY_RADIUS, 0, MAX_VISIBILITY_RADIUS);
+            warnings.append("Warning! VISIBILITY_RADIUS must belong to [0, " + std::to_string(MAX_VISIBILITY_RADIUS) + "]. Fixed by clamping.\n");
+        }
+        // a radius larger than the maze sees nothing more, so it is not a user error
+        fixed.VISIBILITY_RADIUS = std::min(fixed.VISIBILITY_RADIUS, std::max(maze_width(), maze_height()));
+    }
     if (fixed.ROOM_SIZE_MIN % 2 == 0 || fixed.ROOM_SIZE_MAX % 2 == 0) {
         if (fixed.ROOM_SIZE_MIN % 2 == 0) fixed.ROOM_SIZE_MIN -= 1; 
         if (fixed.ROOM_SIZE_MAX % 2 == 0) fixed.ROOM_SIZE_MAX -= 1; 
@@ -340,6 +465,10 @@ Config fix_config(const Config& user_config) {
 
 // Places the rooms randomly
 void place_rooms() {
+    if (cfg.ROOM_TARGET_NUMBER > 0 || cfg.ROOM_TARGET_COVERAGE > 0.0f) {
+        place_rooms_targeted();
+        return;
+    }
     std::uniform_int_distribution<> room_size_distribution(cfg.ROOM_SIZE_MIN, cfg.ROOM_SIZE_MAX);
     int room_avg = cfg.ROOM_SIZE_MIN + (cfg.ROOM_SIZE_MAX - cfg.ROOM_SIZE_MIN) / 2;
     std::uniform_int_distribution<> room_position_x_distribution(0, maze_width() - room_avg);
@@ -377,15 +506,118 @@ void place_rooms() {
             }
             if (breaks_hall_constraint) continue;
         }
-        rooms.push_back(room);
+        add_room(room);
         room_is_placed = true;
-        for (int x = room.min_point.x; x <= room.max_point.x; x++) {
-            for (int y = room.min_point.y; y <= room.max_point.y; y++) {
-                grid[y][x]= room_id;
+    }
+}
+
+
+// Places the rooms only where they fit until ROOM_TARGET_NUMBER or ROOM_TARGET_COVERAGE is reached
+// Samples room corners from a list of room cells where the smallest room may still fit,
+// a corner is dropped once nothing fits there. The cost is linear in the free room cells,
+// which are all listed once, plus at most ROOM_FIT_ATTEMPTS fit tests per placed room
+void place_rooms_targeted() {
+    int cells_width = (maze_width() - 1) / 2;
+    int cells_height = (maze_height() - 1) / 2;
+    CellGrid occupied(cells_height, std::vector<bool>(cells_width, false));
+    if (cfg.CONSTRAIN_HALL_ONLY) {
+        for (const Point& point: point_constraints) {
+            occupied[(point.y - 1) / 2][(point.x - 1) / 2] = true;
+        }
+    }
+
+    int min_size = std::min(cfg.ROOM_SIZE_MIN / 2 + 1, std::min(cells_width, cells_height));
+    Points corners;
+    for (int y = 0; y + min_size <= cells_height; y++) {
+        for (int x = 0; x + min_size <= cells_width; x++) {
+            corners.push_back({x, y});
+        }
+    }
+
+    std::uniform_int_distribution<> room_size_distribution(cfg.ROOM_SIZE_MIN, cfg.ROOM_SIZE_MAX);
+    long long target_area = static_cast<long long>(cfg.ROOM_TARGET_COVERAGE * maze_width() * maze_height());
+    long long covered_area = 0;
+
+    while (min_size > 0 && !corners.empty()) {
+        if (cfg.ROOM_TARGET_NUMBER > 0 && static_cast<int>(rooms.size()) >= cfg.ROOM_TARGET_NUMBER) break;
+        if (cfg.ROOM_TARGET_COVERAGE > 0.0f && covered_area >= target_area) break;
+        if (static_cast<int>(rooms.size()) >= MAX_ROOMS - 1) break;
+        int width = std::min(room_size_distribution(rng) / 2 + 1, cells_width);
+        int height = std::min(room_size_distribution(rng) / 2 + 1, cells_height);
+        // look for a corner where the room of the chosen size fits, corners where nothing fits are dropped
+        int attempts = 0;
+        size_t corner_index = 0;
+        bool is_corner_found = false;
+        while (!corners.empty()) {
+            std::uniform_int_distribution<size_t> corner_distribution(0, corners.size() - 1);
+            corner_index = corner_distribution(rng);
+            if (!is_room_fitting(occupied, corners[corner_index], min_size, min_size)) {
+                std::swap(corners[corner_index], corners.back());
+                corners.pop_back();
+                continue;
+            }
+            is_corner_found = true;
+            if (is_room_fitting(occupied, corners[corner_index], width, height)) break;
+            if (++attempts < ROOM_FIT_ATTEMPTS) continue;
+            // shrink the larger side until the room fits, the smallest room always fits here
+            while (!is_room_fitting(occupied, corners[corner_index], width, height)) {
+                if (width > min_size && (width >= height || height == min_size)) {
+                    width--;
+                } else {
+                    height--;
+                }
+            }
+            break;
+        }
+        if (!is_corner_found) break;
+        Point corner = corners[corner_index];
+        std::swap(corners[corner_index], corners.back());
+        corners.pop_back();
+        for (int y = corner.y; y < corner.y + height; y++) {
+            for (int x = corner.x; x < corner.x + width; x++) {
+                occupied[y][x] = true;
             }
         }
-        room_id++;
+        Room room{{corner.x * 2 + 1, corner.y * 2 + 1}, 
+            {(corner.x + width) * 2 - 1, (corner.y + height) * 2 - 1}, room_id};
+        add_room(room);
+        covered_area += static_cast<long long>(width * 2 - 1) * (height * 2 - 1);
+    }
+
+    if (cfg.ROOM_TARGET_NUMBER > 0 && static_cast<int>(rooms.size()) < cfg.ROOM_TARGET_NUMBER) {
+        warnings.append("Warning! Only " + std::to_string(rooms.size()) + " of ROOM_TARGET_NUMBER = " 
+            + std::to_string(cfg.ROOM_TARGET_NUMBER) + " rooms fit in the maze.\n");
+    }
+    if (cfg.ROOM_TARGET_COVERAGE > 0.0f && covered_area < target_area) {
+        warnings.append("Warning! Rooms fit in the maze cover less than ROOM_TARGET_COVERAGE.\n");
+    }
+}
+
+
+// Returns true if a room with the corner and size in room cells is in bounds and none of its cells are occupied
+bool is_room_fitting(const CellGrid& occupied, const Point& corner, int width, int height) const {
+    if (corner.y + height > static_cast<int>(occupied.size()) 
+            || corner.x + width > static_cast<int>(occupied.front().size())) {
+        return false;
+    }
+    for (int y = corner.y; y < corner.y + height; y++) {
+        for (int x = corner.x; x < corner.x + width; x++) {
+            if (occupied[y][x]) return false;
+        }
     }
+    return true;
+}
+
+
+// Adds the room to the rooms and marks its cells on the grid
+void add_room(const Room& room) {
+    rooms.push_back(room);
+    for (int x = room.min_point.x; x <= room.max_point.x; x++) {
+        for (int y = room.min_point.y; y <= room.max_point.y; y++) {
+            grid[y][x]= room.id;
+        }
+    }
+    room_id++;
 }
 
 
@@ -647,6 +879,149 @@ void reconnect_dead_ends() {
     }
 }
 
+
+
+// Returns true if no wall is between two points, the points themselves may be walls
+// A single line is not symmetric, so the sight is clear if the line is clear in either direction
+bool is_line_of_sight(int x0, int y0, int x1, int y1) const {
+    return is_line_clear(x0, y0, x1, y1) || is_line_clear(x1, y1, x0, y0);
+}
+
+
+// Returns true if Bresenham line from the first point to the second has no walls between them
+// A diagonal step between two walls is blocked
+bool is_line_clear(int x0, int y0, int x1, int y1) const {
+    int dx = std::abs(x1 - x0);
+    int dy = -std::abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (x0 != x1 || y0 != y1) {
+        int e2 = 2 * err;
+        bool step_x = e2 >= dy;
+        bool step_y = e2 <= dx;
+        if (step_x && step_y 
+                && region_at(x0 + sx, y0) == NOTHING_ID && region_at(x0, y0 + sy) == NOTHING_ID) {
+            return false;
+        }
+        if (step_x) {
+            err += dy;
+            x0 += sx;
+        }
+        if (step_y) {
+            err += dx;
+            y0 += sy;
+        }
+        if ((x0 != x1 || y0 != y1) && region_at(x0, y0) == NOTHING_ID) return false;
+    }
+    return true;
+}
+
+
+// Fills the visibility bitmap, which must be reset around the point, using line of sight tests
+void compute_visible_cells(int x, int y, int radius) {
+    OpenRooms open_rooms = open_rooms_at(x, y);
+    for (int dy = -radius; dy <= radius; dy++) {
+        int ty = y + dy;
+        if (ty < 0 || ty >= maze_height()) continue;
+        int half_width = circle_half_width(radius, dy);
+        for (int tx = std::max(x - half_width, 0); tx <= std::min(x + half_width, maze_width() - 1); tx++) {
+            if (is_in_open_room(open_rooms, tx, ty) || is_line_of_sight(x, y, tx, ty)) {
+                visibility_bitmap.set_visible(tx, ty);
+            }
+        }
+    }
+}
+
+
+// Fills the visibility bitmap, which must be reset around the point, from the line of sight cache
+// The cache has the bitmap layout for los_radius, so it is copied by words, smaller radius copies circle rows
+void copy_cached_cells(int slot, int radius) {
+    const uint64_t* cached = los_cache.data() + static_cast<size_t>(slot) * los_words_per_cell;
+    uint64_t* bits = visibility_bitmap.bits.data();
+    if (radius == los_radius) {
+        std::copy(cached, cached + los_words_per_cell, bits);
+        return;
+    }
+    size_t cache_size = 2 * los_radius + 1;
+    size_t size = 2 * radius + 1;
+    for (int dy = -radius; dy <= radius; dy++) {
+        int half_width = circle_half_width(radius, dy);
+        size_t from = (dy + los_radius) * cache_size + los_radius - half_width;
+        size_t to = (dy + radius) * size + radius - half_width;
+        for (int copied = 0; copied < 2 * half_width + 1; copied += 64) {
+            int number = std::min(64, 2 * half_width + 1 - copied);
+            write_bits(bits, to + copied, number, read_bits(cached, from + copied, number));
+        }
+    }
+}
+
+
+// Returns the rooms seen as a whole without line of sight tests: a room is an open rectangle,
+// so it and its walls are visible from inside it and from the doors opening to it
+OpenRooms open_rooms_at(int x, int y) const {
+    OpenRooms open_rooms{};
+    int id = region_at(x, y);
+    if (is_room(id)) {
+        open_rooms[0] = &rooms[id - ROOM_ID_START];
+    } else if (is_door(id)) {
+        for (size_t i = 0; i < CARDINALS.size(); i++) {
+            int neighbour_id = region_at(x + CARDINALS[i].dx, y + CARDINALS[i].dy);
+            if (is_room(neighbour_id)) open_rooms[i] = &rooms[neighbour_id - ROOM_ID_START];
+        }
+    }
+    return open_rooms;
+}
+
+
+// Returns true if a point is in one of the open rooms or their walls
+bool is_in_open_room(const OpenRooms& open_rooms, int x, int y) const {
+    for (const Room* room: open_rooms) {
+        if (room != nullptr && x >= room->min_point.x - 1 && x <= room->max_point.x + 1
+                && y >= room->min_point.y - 1 && y <= room->max_point.y + 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Precomputes visibility within VISIBILITY_RADIUS for every open cell of the maze
+// Each cell stores the visibility bitmap as is, so visible_cells() copies it without line of sight tests
+// If there is not enough memory, nothing is cached and visible_cells() computes everything directly
+void build_visibility() {
+    if (!cfg.BUILD_VISIBILITY) return;
+    int size = 2 * cfg.VISIBILITY_RADIUS + 1;
+    size_t words_per_cell = (static_cast<size_t>(size) * size + 63) / 64;
+    size_t open_cells = 0;
+    for (int y = 0; y < maze_height(); y++) {
+        for (int x = 0; x < maze_width(); x++) {
+            if (region_at(x, y) != NOTHING_ID) open_cells++;
+        }
+    }
+    try {
+        los_slots.assign(maze_width() * maze_height(), -1);
+        los_cache.reserve(open_cells * words_per_cell);
+    } catch (const std::bad_alloc&) {
+        los_slots = std::vector<int>();
+        los_cache = std::vector<uint64_t>();
+        warnings.append("Warning! Not enough memory to precompute visibility. Skipped.\n");
+        return;
+    }
+    los_radius = cfg.VISIBILITY_RADIUS;
+    los_words_per_cell = words_per_cell;
+    int slot = 0;
+    for (int y = 0; y < maze_height(); y++) {
+        for (int x = 0; x < maze_width(); x++) {
+            if (region_at(x, y) == NOTHING_ID) continue;
+            visibility_bitmap.reset(x, y, los_radius);
+            compute_visible_cells(x, y, los_radius);
+            los_slots[y * maze_width() + x] = slot++;
+            los_cache.insert(los_cache.end(), visibility_bitmap.bits.begin(), visibility_bitmap.bits.end());
+        }
+    }
+}
+
 };
 }
 